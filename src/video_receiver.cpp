@@ -0,0 +1,645 @@
+#include <gst/gst.h>
+#include <glib.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bitset>
+#include <cmath>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+static GMainLoop* g_loop = nullptr;
+static std::atomic<GstElement*> g_fecdec{nullptr};
+
+constexpr guint RTP_PT_H264 = 96;
+constexpr guint RTP_PT_ULPFEC = 122;
+
+constexpr int RTP_MAX_GAP = 1000;
+constexpr size_t RTP_HOLE_WINDOW = 1024;
+
+constexpr size_t TS_PACKET = 188;
+constexpr guint16 TS_NULL_PID = 0x1FFF;
+
+// Everything below is written from streaming threads and read from the
+// main loop, so it is guarded by one mutex; the per-packet work is a few
+// integer ops.
+struct RxStats
+{
+    std::mutex lock;
+
+    bool rtp = false;
+    bool keepSamples = false;
+
+    // Packet level, counted where packets enter the depayloader/demuxer.
+    // `packets` are UDP datagrams; loss is counted in the stream's own unit
+    // (RTP packets, or TS packets of which one datagram carries up to 7),
+    // and `units` is the matching denominator.
+    guint64 packets = 0;
+    guint64 bytes = 0;
+    guint64 units = 0;
+    guint64 lost = 0;
+    guint64 reordered = 0;
+    guint64 duplicates = 0;
+    int lastSeq = -1;
+    // Sequence numbers counted as lost, indexed by seq % RTP_HOLE_WINDOW.
+    // The window is wider than RTP_MAX_GAP, so every slot a forward step
+    // reuses is rewritten by that step.
+    std::bitset<RTP_HOLE_WINDOW> holes;
+    std::array<gint8, 8192> lastCc{};
+
+    // Frame level: RFC 3550 style interarrival jitter against the PTS.
+    guint64 frames = 0;
+    gint64 lastArrivalUs = 0;
+    GstClockTime lastPts = GST_CLOCK_TIME_NONE;
+    double jitterMs = 0.0;
+    double maxDeviationMs = 0.0;
+
+    // Decode: PTS -> time it entered the decoder.
+    std::deque<std::pair<GstClockTime, gint64>> inflight;
+    guint64 decoded = 0;
+    double decodeSumMs = 0.0;
+    double decodeMaxMs = 0.0;
+    std::vector<double> decodeSamples;
+
+    // Frames that reached the consumer; the rest were dropped by appsink
+    // because the consumer was still busy with the previous one.
+    guint64 handedOff = 0;
+
+    gint64 startUs = 0;
+    gint64 firstPacketUs = 0;
+    gint64 firstFrameUs = 0;
+    gint64 stopUs = 0;
+};
+
+static RxStats g_stats;
+
+// Headless consumers get each decoded frame as a borrowed GstSample: it
+// references the decoder's output buffer, so nothing is copied. Take a ref
+// (gst_sample_ref) to keep the frame past the call.
+typedef void (*FrameHandler)(GstSample* sample, gpointer data);
+
+static FrameHandler g_frameHandler = nullptr;
+static gpointer g_frameHandlerData = nullptr;
+
+static void onSignal(int)
+{
+    if (g_loop) g_main_loop_quit(g_loop);
+}
+
+static gboolean bus_call(GstBus* bus, GstMessage* msg, gpointer /*data*/)
+{
+    switch (GST_MESSAGE_TYPE(msg)) {
+    case GST_MESSAGE_ERROR: {
+        GError* err = nullptr;
+        gchar* dbg = nullptr;
+        gst_message_parse_error(msg, &err, &dbg);
+        std::fprintf(stderr, "[GST] ERROR: %s\n", err ? err->message : "unknown");
+        if (dbg) std::fprintf(stderr, "[GST] DEBUG: %s\n", dbg);
+        if (err) g_error_free(err);
+        if (dbg) g_free(dbg);
+        if (g_loop) g_main_loop_quit(g_loop);
+        break;
+    }
+    case GST_MESSAGE_EOS:
+        std::printf("[GST] EOS\n");
+        if (g_loop) g_main_loop_quit(g_loop);
+        break;
+    default:
+        break;
+    }
+    (void)bus;
+    return TRUE;
+}
+
+static GstCaps* on_request_pt_map(GstElement* /*rtpbin*/, guint /*session*/, guint pt, gpointer /*data*/)
+{
+    if (pt == RTP_PT_H264) {
+        return gst_caps_new_simple("application/x-rtp",
+                                   "media", G_TYPE_STRING, "video",
+                                   "clock-rate", G_TYPE_INT, 90000,
+                                   "encoding-name", G_TYPE_STRING, "H264",
+                                   "payload", G_TYPE_INT, (gint)RTP_PT_H264,
+                                   nullptr);
+    }
+    if (pt == RTP_PT_ULPFEC) {
+        return gst_caps_new_simple("application/x-rtp",
+                                   "media", G_TYPE_STRING, "video",
+                                   "clock-rate", G_TYPE_INT, 90000,
+                                   "encoding-name", G_TYPE_STRING, "ULPFEC",
+                                   "payload", G_TYPE_INT, (gint)RTP_PT_ULPFEC,
+                                   nullptr);
+    }
+    return nullptr;
+}
+
+// rtpbin inserts this after the jitterbuffer: it rebuilds media packets from
+// the RTP storage whenever the jitterbuffer reports a gap.
+static GstElement* on_request_fec_decoder(GstElement* rtpbin, guint session, gpointer /*data*/)
+{
+    GstElement* dec = gst_element_factory_make("rtpulpfecdec", nullptr);
+    if (!dec) {
+        std::fprintf(stderr, "rtpulpfecdec not available, FEC recovery disabled\n");
+        return nullptr;
+    }
+
+    GObject* storage = nullptr;
+    g_signal_emit_by_name(rtpbin, "get-internal-storage", session, &storage);
+    g_object_set(G_OBJECT(dec),
+                 "storage", storage,
+                 "pt", RTP_PT_ULPFEC,
+                 nullptr);
+    if (storage) g_object_unref(storage);
+
+    GstElement* prev = g_fecdec.exchange(GST_ELEMENT(gst_object_ref(dec)));
+    if (prev) gst_object_unref(prev);
+    return dec;
+}
+
+// Links the media pad of rtpbin ("recv_rtp_src_*") or tsdemux ("video_*").
+static void on_pad_added(GstElement* /*element*/, GstPad* pad, gpointer data)
+{
+    GstElement* next = GST_ELEMENT(data);
+
+    gchar* name = gst_pad_get_name(pad);
+    const bool isVideo = g_str_has_prefix(name, "recv_rtp_src_") || g_str_has_prefix(name, "video_");
+    g_free(name);
+    if (!isVideo) return;
+
+    GstPad* sinkpad = gst_element_get_static_pad(next, "sink");
+    if (!gst_pad_is_linked(sinkpad) && gst_pad_link(pad, sinkpad) != GST_PAD_LINK_OK) {
+        std::fprintf(stderr, "Failed to link %s pad\n", GST_OBJECT_NAME(next));
+    }
+    gst_object_unref(sinkpad);
+}
+
+static void count_rtp(const guint8* data, gsize size)
+{
+    if (size < 12 || (data[0] >> 6) != 2) return;
+    ++g_stats.units;
+
+    const int seq = (data[2] << 8) | data[3];
+    if (g_stats.lastSeq < 0) {
+        g_stats.lastSeq = seq;
+        return;
+    }
+
+    const int delta = (gint16)(seq - g_stats.lastSeq);
+    if (delta > 0 && delta < RTP_MAX_GAP) {
+        for (int i = 1; i < delta; ++i) g_stats.holes.set(((g_stats.lastSeq + i) & 0xFFFF) % RTP_HOLE_WINDOW);
+        g_stats.holes.reset(seq % RTP_HOLE_WINDOW);
+        g_stats.lost += delta - 1;
+        g_stats.lastSeq = seq;
+    } else if (delta < 0 && delta > -RTP_MAX_GAP) {
+        // Only a packet that fills a counted hole is a reorder; anything
+        // else behind lastSeq is a duplicate.
+        if (g_stats.holes.test(seq % RTP_HOLE_WINDOW)) {
+            g_stats.holes.reset(seq % RTP_HOLE_WINDOW);
+            --g_stats.lost;
+            ++g_stats.reordered;
+        } else {
+            ++g_stats.duplicates;
+        }
+    } else if (delta == 0) {
+        ++g_stats.duplicates;
+    } else {
+        // Sender restart or a long outage: resync rather than guess.
+        g_stats.holes.reset();
+        g_stats.lastSeq = seq;
+    }
+}
+
+// Continuity counters are 4 bits per PID, so a burst of 16 or more missing
+// packets on one PID (about 3 datagrams) wraps around and is undercounted
+// by a multiple of 16.
+static void count_ts(const guint8* data, gsize size)
+{
+    for (gsize off = 0; off + TS_PACKET <= size; off += TS_PACKET) {
+        const guint8* p = data + off;
+        if (p[0] != 0x47) return;
+
+        const guint16 pid = ((p[1] & 0x1F) << 8) | p[2];
+        const bool hasPayload = (p[3] & 0x10) != 0;
+        const gint8 cc = p[3] & 0x0F;
+        if (pid == TS_NULL_PID || !hasPayload) continue;
+        ++g_stats.units;
+
+        // lastCc is stored +1 so zero-initialised means "not seen yet".
+        const gint8 last = g_stats.lastCc[pid] - 1;
+        if (last >= 0 && cc != last) g_stats.lost += (cc - last - 1) & 0x0F;
+        g_stats.lastCc[pid] = cc + 1;
+    }
+}
+
+static GstPadProbeReturn packet_probe(GstPad*, GstPadProbeInfo* info, gpointer)
+{
+    GstBuffer* buf = GST_PAD_PROBE_INFO_BUFFER(info);
+    GstMapInfo map;
+    if (!gst_buffer_map(buf, &map, GST_MAP_READ)) return GST_PAD_PROBE_OK;
+
+    {
+        std::lock_guard<std::mutex> guard(g_stats.lock);
+        if (g_stats.packets == 0) g_stats.firstPacketUs = g_get_monotonic_time();
+        ++g_stats.packets;
+        g_stats.bytes += map.size;
+        if (g_stats.rtp) count_rtp(map.data, map.size);
+        else count_ts(map.data, map.size);
+    }
+
+    gst_buffer_unmap(buf, &map);
+    return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn frame_probe(GstPad*, GstPadProbeInfo* info, gpointer)
+{
+    GstBuffer* buf = GST_PAD_PROBE_INFO_BUFFER(info);
+    const GstClockTime pts = GST_BUFFER_PTS(buf);
+    const gint64 now = g_get_monotonic_time();
+
+    std::lock_guard<std::mutex> guard(g_stats.lock);
+    ++g_stats.frames;
+    if (GST_CLOCK_TIME_IS_VALID(pts) && GST_CLOCK_TIME_IS_VALID(g_stats.lastPts)) {
+        const double arrivalMs = (now - g_stats.lastArrivalUs) / 1000.0;
+        const double ptsMs = ((gint64)pts - (gint64)g_stats.lastPts) / (double)GST_MSECOND;
+        const double d = std::fabs(arrivalMs - ptsMs);
+        g_stats.jitterMs += (d - g_stats.jitterMs) / 16.0;
+        g_stats.maxDeviationMs = std::max(g_stats.maxDeviationMs, d);
+    }
+    g_stats.lastArrivalUs = now;
+    g_stats.lastPts = pts;
+
+    if (GST_CLOCK_TIME_IS_VALID(pts)) {
+        g_stats.inflight.emplace_back(pts, now);
+        // The decoder never holds more than a few frames; anything older was
+        // dropped inside it.
+        while (g_stats.inflight.size() > 16) g_stats.inflight.pop_front();
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn decoded_probe(GstPad*, GstPadProbeInfo* info, gpointer)
+{
+    const GstClockTime pts = GST_BUFFER_PTS(GST_PAD_PROBE_INFO_BUFFER(info));
+    const gint64 now = g_get_monotonic_time();
+
+    std::lock_guard<std::mutex> guard(g_stats.lock);
+    if (g_stats.firstFrameUs == 0) g_stats.firstFrameUs = now;
+
+    while (!g_stats.inflight.empty()) {
+        const std::pair<GstClockTime, gint64> f = g_stats.inflight.front();
+        if (f.first > pts) break;
+        g_stats.inflight.pop_front();
+        if (f.first != pts) continue;
+
+        const double ms = (now - f.second) / 1000.0;
+        ++g_stats.decoded;
+        g_stats.decodeSumMs += ms;
+        g_stats.decodeMaxMs = std::max(g_stats.decodeMaxMs, ms);
+        if (g_stats.keepSamples) g_stats.decodeSamples.push_back(ms);
+        break;
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+static GstFlowReturn on_new_sample(GstElement* appsink, gpointer /*data*/)
+{
+    GstSample* sample = nullptr;
+    g_signal_emit_by_name(appsink, "pull-sample", &sample);
+    if (!sample) return GST_FLOW_EOS;
+
+    if (g_frameHandler) g_frameHandler(sample, g_frameHandlerData);
+
+    gst_sample_unref(sample);
+    return GST_FLOW_OK;
+}
+
+// The only consumer in this tree counts delivered frames for the stats;
+// an on-PC vision or display consumer would be installed here instead.
+static void count_frame(GstSample* /*sample*/, gpointer /*data*/)
+{
+    std::lock_guard<std::mutex> guard(g_stats.lock);
+    ++g_stats.handedOff;
+}
+
+static const char* loss_unit()
+{
+    return g_stats.rtp ? "RTP" : "TS";
+}
+
+static double loss_percent(guint64 units, guint64 lost)
+{
+    return (units + lost) ? 100.0 * lost / (units + lost) : 0.0;
+}
+
+static gboolean print_stats(gpointer /*data*/)
+{
+    guint64 packets, units, lost, reordered, frames, decoded;
+    double jitterMs, decodeAvgMs, decodeMaxMs;
+    {
+        std::lock_guard<std::mutex> guard(g_stats.lock);
+        packets = g_stats.packets;
+        units = g_stats.units;
+        lost = g_stats.lost;
+        reordered = g_stats.reordered;
+        frames = g_stats.frames;
+        decoded = g_stats.decoded;
+        jitterMs = g_stats.jitterMs;
+        decodeAvgMs = decoded ? g_stats.decodeSumMs / decoded : 0.0;
+        decodeMaxMs = g_stats.decodeMaxMs;
+    }
+
+    std::printf("[RX] dgrams=%llu %s lost=%llu/%llu (%.2f%%) reordered=%llu frames=%llu jitter=%.2fms decode avg=%.2fms max=%.2fms\n",
+                (unsigned long long)packets, loss_unit(), (unsigned long long)lost,
+                (unsigned long long)(units + lost), loss_percent(units, lost), (unsigned long long)reordered,
+                (unsigned long long)frames, jitterMs, decodeAvgMs, decodeMaxMs);
+
+    GstElement* dec = g_fecdec.load();
+    if (dec) {
+        guint recovered = 0;
+        guint unrecovered = 0;
+        g_object_get(G_OBJECT(dec),
+                     "recovered", &recovered,
+                     "unrecovered", &unrecovered,
+                     nullptr);
+        std::printf("[FEC] recovered=%u unrecovered=%u\n", recovered, unrecovered);
+    }
+    return TRUE;
+}
+
+static double percentile(std::vector<double>& v, double p)
+{
+    if (v.empty()) return 0.0;
+    const size_t idx = std::min(v.size() - 1, (size_t)(p * (v.size() - 1) + 0.5));
+    std::nth_element(v.begin(), v.begin() + idx, v.end());
+    return v[idx];
+}
+
+static gboolean end_bench(gpointer /*data*/)
+{
+    if (g_loop) g_main_loop_quit(g_loop);
+    return G_SOURCE_REMOVE;
+}
+
+static int print_bench_summary(int seconds)
+{
+    std::lock_guard<std::mutex> guard(g_stats.lock);
+    std::vector<double>& d = g_stats.decodeSamples;
+
+    // Rates cover the time packets were actually flowing, which differs from
+    // --bench when the sender starts late or the run is interrupted.
+    const gint64 fromUs = g_stats.firstPacketUs ? g_stats.firstPacketUs : g_stats.startUs;
+    const double elapsed = std::max(g_stats.stopUs - fromUs, (gint64)1) / 1e6;
+
+    std::printf("\n=== video_receiver bench (%ds requested, %.1fs measured, %s) ===\n",
+                seconds, elapsed, g_stats.rtp ? "RTP" : "MPEG-TS");
+    std::printf("first frame:   %.1f ms after PLAYING\n",
+                g_stats.firstFrameUs ? (g_stats.firstFrameUs - g_stats.startUs) / 1000.0 : -1.0);
+    std::printf("datagrams:     %llu (%.1f kbit/s)\n", (unsigned long long)g_stats.packets,
+                g_stats.bytes * 8.0 / 1000.0 / elapsed);
+    std::printf("lost %s pkts: %llu of %llu (%.2f%%), %llu reordered, %llu duplicate\n", loss_unit(),
+                (unsigned long long)g_stats.lost, (unsigned long long)(g_stats.units + g_stats.lost),
+                loss_percent(g_stats.units, g_stats.lost), (unsigned long long)g_stats.reordered,
+                (unsigned long long)g_stats.duplicates);
+    std::printf("frames:        %llu (%.1f fps)\n", (unsigned long long)g_stats.frames,
+                g_stats.frames / elapsed);
+    std::printf("jitter:        %.2f ms (max deviation %.2f ms)\n", g_stats.jitterMs, g_stats.maxDeviationMs);
+    std::printf("decode:        p50=%.2f p95=%.2f p99=%.2f max=%.2f ms (%llu frames)\n",
+                percentile(d, 0.50), percentile(d, 0.95), percentile(d, 0.99), g_stats.decodeMaxMs,
+                (unsigned long long)g_stats.decoded);
+    std::printf("handed off:    %llu frames (%llu dropped for a busy consumer)\n",
+                (unsigned long long)g_stats.handedOff,
+                (unsigned long long)(g_stats.decoded > g_stats.handedOff ? g_stats.decoded - g_stats.handedOff : 0));
+
+    return g_stats.decoded > 0 ? 0 : 1;
+}
+
+static void usage(const char* prog)
+{
+    std::fprintf(stderr, "Usage: %s [port] [--rtp] [--latency <ms>] [--drop <percent>] [--headless] [--bench <seconds>]\n", prog);
+    std::fprintf(stderr, "  --rtp              expect H264/RTP (+ ULPFEC) instead of MPEG-TS\n");
+    std::fprintf(stderr, "  --latency <ms>     RTP jitterbuffer latency, bounds how long FEC may wait (default 40)\n");
+    std::fprintf(stderr, "  --drop <percent>   drop incoming packets at random to exercise recovery\n");
+    std::fprintf(stderr, "  --headless         hand decoded frames to an appsink instead of a window\n");
+    std::fprintf(stderr, "  --bench <seconds>  headless run, then print a latency/loss summary and exit\n");
+}
+
+int main(int argc, char** argv)
+{
+    gst_init(&argc, &argv);
+
+    int port = 5600;
+    bool rtp = false;
+    int latencyMs = 40;
+    double dropPercent = 0.0;
+    bool headless = false;
+    int benchSeconds = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--rtp") == 0) {
+            rtp = true;
+        } else if (std::strcmp(argv[i], "--latency") == 0 && i + 1 < argc) {
+            latencyMs = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--drop") == 0 && i + 1 < argc) {
+            dropPercent = std::atof(argv[++i]);
+        } else if (std::strcmp(argv[i], "--headless") == 0) {
+            headless = true;
+        } else if (std::strcmp(argv[i], "--bench") == 0 && i + 1 < argc) {
+            benchSeconds = std::atoi(argv[++i]);
+            headless = true;
+        } else if (argv[i][0] != '-') {
+            port = std::atoi(argv[i]);
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    std::signal(SIGINT, onSignal);
+    std::signal(SIGTERM, onSignal);
+
+    g_stats.rtp = rtp;
+    g_stats.keepSamples = benchSeconds > 0;
+
+    GstElement* pipeline = gst_pipeline_new("video_rx");
+    GstElement* src      = gst_element_factory_make("udpsrc", "src");
+    GstElement* netsim   = (dropPercent > 0.0) ? gst_element_factory_make("netsim", "netsim") : nullptr;
+    GstElement* parse    = gst_element_factory_make("h264parse", "parse");
+    GstElement* dec      = gst_element_factory_make("avdec_h264", "dec");
+    GstElement* conv     = headless ? nullptr : gst_element_factory_make("videoconvert", "conv");
+    GstElement* sink     = gst_element_factory_make(headless ? "appsink" : "autovideosink", "sink");
+
+    // RTP goes through rtpbin for the jitterbuffer and FEC; TS is demuxed
+    // directly, with no jitterbuffer at all.
+    GstElement* rtpbin = nullptr;
+    GstElement* depay  = nullptr;
+    GstElement* demux  = nullptr;
+    if (rtp) {
+        rtpbin = gst_element_factory_make("rtpbin", "rtpbin");
+        depay  = gst_element_factory_make("rtph264depay", "depay");
+    } else {
+        demux = gst_element_factory_make("tsdemux", "demux");
+    }
+
+    if (!pipeline || !src || !parse || !dec || !sink || (!headless && !conv) ||
+        (dropPercent > 0.0 && !netsim) || (rtp ? (!rtpbin || !depay) : !demux)) {
+        std::fprintf(stderr, "Failed to create one or more GStreamer elements.\n");
+        std::fprintf(stderr, "Check plugins installed: %s, h264parse, avdec_h264%s.\n",
+                     rtp ? "rtpbin, rtph264depay" : "tsdemux",
+                     dropPercent > 0.0 ? ", netsim" : "");
+        return 1;
+    }
+
+    g_object_set(G_OBJECT(src),
+                 "port", port,
+                 nullptr);
+
+    if (rtp) {
+        GstCaps* caps = on_request_pt_map(nullptr, 0, RTP_PT_H264, nullptr);
+        g_object_set(G_OBJECT(src),
+                     "caps", caps,
+                     nullptr);
+        gst_caps_unref(caps);
+
+        g_object_set(G_OBJECT(rtpbin),
+                     "latency", (guint)latencyMs,
+                     "do-lost", TRUE,
+                     "drop-on-latency", TRUE,
+                     nullptr);
+    }
+
+    // Frame threading would add one frame of delay per thread.
+    gst_util_set_object_arg(G_OBJECT(dec), "thread-type", "slice");
+
+    if (headless) {
+        g_object_set(G_OBJECT(sink),
+                     "emit-signals", TRUE,
+                     "max-buffers", 1u,
+                     "drop", TRUE,
+                     "sync", FALSE,
+                     nullptr);
+        g_frameHandler = count_frame;
+        g_signal_connect(sink, "new-sample", G_CALLBACK(on_new_sample), nullptr);
+    } else {
+        g_object_set(G_OBJECT(sink),
+                     "sync", FALSE,
+                     nullptr);
+    }
+
+    if (netsim) {
+        g_object_set(G_OBJECT(netsim),
+                     "drop-probability", (gfloat)(dropPercent / 100.0),
+                     nullptr);
+    }
+
+    gst_bin_add_many(GST_BIN(pipeline), src, parse, dec, sink, nullptr);
+    if (netsim) gst_bin_add(GST_BIN(pipeline), netsim);
+    if (conv) gst_bin_add(GST_BIN(pipeline), conv);
+
+    bool linked = conv ? gst_element_link_many(parse, dec, conv, sink, nullptr)
+                       : gst_element_link_many(parse, dec, sink, nullptr);
+    GstElement* in = src;
+    if (linked && netsim) {
+        linked = gst_element_link(src, netsim);
+        in = netsim;
+    }
+
+    if (linked && rtp) {
+        g_signal_connect(rtpbin, "request-pt-map", G_CALLBACK(on_request_pt_map), nullptr);
+        g_signal_connect(rtpbin, "request-fec-decoder", G_CALLBACK(on_request_fec_decoder), nullptr);
+        g_signal_connect(rtpbin, "pad-added", G_CALLBACK(on_pad_added), depay);
+
+        gst_bin_add_many(GST_BIN(pipeline), rtpbin, depay, nullptr);
+        linked = gst_element_link_pads(in, "src", rtpbin, "recv_rtp_sink_0") &&
+                 gst_element_link(depay, parse);
+    } else if (linked) {
+        g_signal_connect(demux, "pad-added", G_CALLBACK(on_pad_added), parse);
+
+        gst_bin_add(GST_BIN(pipeline), demux);
+        linked = gst_element_link(in, demux);
+    }
+
+    if (!linked) {
+        std::fprintf(stderr, "Failed to link pipeline elements\n");
+        return 1;
+    }
+
+    if (rtp) {
+        // The FEC storage must hold packets at least as long as the
+        // jitterbuffer waits, otherwise the decoder has nothing to rebuild from.
+        GstElement* storage = nullptr;
+        g_signal_emit_by_name(rtpbin, "get-storage", 0u, &storage);
+        if (storage) {
+            g_object_set(G_OBJECT(storage),
+                         "size-time", (guint64)(latencyMs + 200) * GST_MSECOND,
+                         nullptr);
+            gst_object_unref(storage);
+        }
+    }
+
+    // Loss is counted after netsim so simulated drops show up as well.
+    GstPad* pad = gst_element_get_static_pad(in, "src");
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, packet_probe, nullptr, nullptr);
+    gst_object_unref(pad);
+
+    pad = gst_element_get_static_pad(dec, "sink");
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, frame_probe, nullptr, nullptr);
+    gst_object_unref(pad);
+
+    pad = gst_element_get_static_pad(dec, "src");
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, decoded_probe, nullptr, nullptr);
+    gst_object_unref(pad);
+
+    GstBus* bus = gst_pipeline_get_bus(GST_PIPELINE(pipeline));
+    gst_bus_add_watch(bus, bus_call, nullptr);
+    gst_object_unref(bus);
+
+    g_timeout_add_seconds(1, print_stats, nullptr);
+    if (benchSeconds > 0) g_timeout_add_seconds(benchSeconds, end_bench, nullptr);
+
+    if (rtp) {
+        std::printf("Starting video RX on :%d (H264/RTP + ULPFEC, latency %dms, drop %.1f%%)\n",
+                    port, latencyMs, dropPercent);
+    } else {
+        std::printf("Starting video RX on :%d (H264/MPEGTS, drop %.1f%%)\n", port, dropPercent);
+    }
+
+    g_stats.startUs = g_get_monotonic_time();
+    GstStateChangeReturn ret = gst_element_set_state(pipeline, GST_STATE_PLAYING);
+    if (ret == GST_STATE_CHANGE_FAILURE) {
+        std::fprintf(stderr, "Failed to set pipeline to PLAYING\n");
+        gst_object_unref(pipeline);
+        return 1;
+    }
+
+    g_loop = g_main_loop_new(nullptr, FALSE);
+    g_main_loop_run(g_loop);
+
+    {
+        std::lock_guard<std::mutex> guard(g_stats.lock);
+        g_stats.stopUs = g_get_monotonic_time();
+    }
+
+    std::printf("\nStopping...\n");
+    print_stats(nullptr);
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+
+    int status = 0;
+    if (benchSeconds > 0) status = print_bench_summary(benchSeconds);
+
+    GstElement* fecdec = g_fecdec.exchange(nullptr);
+    if (fecdec) gst_object_unref(fecdec);
+
+    gst_object_unref(pipeline);
+    if (g_loop) {
+        g_main_loop_unref(g_loop);
+        g_loop = nullptr;
+    }
+
+    return status;
+}
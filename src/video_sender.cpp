@@ -1,18 +1,381 @@
 #include <gst/gst.h>
 #include <glib.h>
 
+#include <atomic>
 #include <csignal>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <string>
+#include <vector>
 
 static GMainLoop* g_loop = nullptr;
 
+constexpr guint RTP_PT_H264 = 96;
+constexpr guint RTP_PT_ULPFEC = 122;
+constexpr guint RTP_MTU = 1200;
+
+constexpr int WIDTH = 640;
+constexpr int HEIGHT = 360;
+constexpr int FPS = 30;
+constexpr guint SHM_FRAMES = 4;
+
+constexpr size_t MAX_RESTARTS = 5;
+constexpr gint64 RESTART_WINDOW_US = 30 * G_USEC_PER_SEC;
+
+// Elements on the driver path that can be cycled through NULL in place.
+// Groups are ordered upstream first; the mux/payloader and udpsink after
+// them are never touched, so the socket and stream continuity survive.
+// `feed` is the upstream pad pushing into the group, if any: it is kept
+// dropping buffers while the group is down, so whatever feeds it keeps
+// seeing GST_FLOW_OK instead of FLUSHING.
+struct RestartGroup
+{
+    const char* name = nullptr;
+    std::vector<GstElement*> elements;
+    GstPad* feed = nullptr;
+    std::vector<gint64> restarts;
+    std::atomic<bool> failed{false};
+};
+
+enum { GROUP_CAMERA, GROUP_ENCODER, GROUP_COUNT };
+
+// Optional consumers hanging off a tee. A failing one is cut off rather
+// than restarted so it can never stall the driver path.
+struct SideBranch
+{
+    const char* name = nullptr;
+    GstElement* queue = nullptr;
+    GstElement* sink = nullptr;
+    std::atomic<bool> dead{false};
+    bool reported = false;
+};
+
+enum { BRANCH_SHM, BRANCH_SPECTATOR, BRANCH_COUNT };
+
+static RestartGroup g_groups[GROUP_COUNT];
+static SideBranch g_branches[BRANCH_COUNT];
+static GstElement* g_pipeline = nullptr;
+static GstElement* g_enc = nullptr;
+static GstElement* g_testSrc = nullptr;
+static GstAllocator* g_shmAllocator = nullptr;
+static GstAllocationParams g_shmParams;
+static unsigned g_pendingGroups = 0;
+
+// A TTFF measurement waits for the encoder's first keyframe at or after
+// g_ttffMinPts, then ends when that keyframe's first packet reaches the
+// socket. Delta frames before it are not decodable and do not count.
+enum { TTFF_IDLE, TTFF_WAIT_KEY, TTFF_WAIT_SEND };
+
+static gint64 g_processStartUs = 0;
+static std::atomic<int> g_ttffState{TTFF_IDLE};
+static std::atomic<gint64> g_ttffStartUs{0};
+static std::atomic<guint64> g_ttffMinPts{0};
+static std::atomic<guint64> g_ttffKeyPts{0};
+static std::atomic<int> g_recoveries{0};
+
 static void onSignal(int)
 {
     if (g_loop) g_main_loop_quit(g_loop);
 }
 
+static bool owns(GstElement* element, GstObject* obj)
+{
+    return obj == GST_OBJECT(element) || gst_object_has_as_ancestor(obj, GST_OBJECT(element));
+}
+
+static void request_keyframe()
+{
+    GstStructure* s = gst_structure_new("GstForceKeyUnit",
+                                        "running-time", G_TYPE_UINT64, (guint64)GST_CLOCK_TIME_NONE,
+                                        "all-headers", G_TYPE_BOOLEAN, TRUE,
+                                        "count", G_TYPE_UINT, 0u,
+                                        nullptr);
+    if (!gst_element_send_event(g_enc, gst_event_new_custom(GST_EVENT_CUSTOM_UPSTREAM, s))) {
+        std::fprintf(stderr, "[RECOVER] encoder ignored force-key-unit\n");
+    }
+}
+
+static GstClockTime running_time_now()
+{
+    GstClock* clock = gst_element_get_clock(g_pipeline);
+    if (!clock) return 0;
+    const GstClockTime now = gst_clock_get_time(clock);
+    gst_object_unref(clock);
+    return now - gst_element_get_base_time(g_pipeline);
+}
+
+static bool restart_budget_left(RestartGroup& group, gint64 now)
+{
+    std::vector<gint64> recent;
+    for (gint64 t : group.restarts) {
+        if (now - t < RESTART_WINDOW_US) recent.push_back(t);
+    }
+    group.restarts.swap(recent);
+    return group.restarts.size() < MAX_RESTARTS;
+}
+
+static GstPadProbeReturn drop_probe(GstPad*, GstPadProbeInfo*, gpointer)
+{
+    return GST_PAD_PROBE_DROP;
+}
+
+// The restarted group's sink pad lost its sticky events when it was
+// deactivated, and upstream considers them delivered; replay them so the
+// first buffer after the restart arrives with stream-start, caps and segment.
+static gboolean resend_sticky(GstPad* /*pad*/, GstEvent** event, gpointer data)
+{
+    if (GST_EVENT_TYPE(*event) != GST_EVENT_EOS) gst_pad_send_event(GST_PAD(data), gst_event_ref(*event));
+    return TRUE;
+}
+
+static gboolean restart_groups(gpointer /*data*/)
+{
+    const unsigned pending = g_pendingGroups;
+    g_pendingGroups = 0;
+
+    // Check every group before recording anything, so a restart that is
+    // abandoned does not eat into another group's budget.
+    const gint64 now = g_get_monotonic_time();
+    for (size_t i = 0; i < GROUP_COUNT; ++i) {
+        if (!(pending & (1u << i))) continue;
+        if (!restart_budget_left(g_groups[i], now)) {
+            std::fprintf(stderr, "[RECOVER] %s failed %zu times in %llds, giving up\n",
+                         g_groups[i].name, MAX_RESTARTS, (long long)(RESTART_WINDOW_US / G_USEC_PER_SEC));
+            if (g_loop) g_main_loop_quit(g_loop);
+            return G_SOURCE_REMOVE;
+        }
+    }
+    for (size_t i = 0; i < GROUP_COUNT; ++i) {
+        if (pending & (1u << i)) g_groups[i].restarts.push_back(now);
+    }
+
+    // Publish the state last: the probes key off it, and keyframes still
+    // queued downstream from before the restart must not stop the timer.
+    g_ttffMinPts = running_time_now();
+    ++g_recoveries;
+    g_ttffStartUs = g_get_monotonic_time();
+    g_ttffState = TTFF_WAIT_KEY;
+
+    gulong feedProbes[GROUP_COUNT] = {};
+    for (size_t i = 0; i < GROUP_COUNT; ++i) {
+        if (!(pending & (1u << i)) || !g_groups[i].feed) continue;
+        feedProbes[i] = gst_pad_add_probe(g_groups[i].feed,
+                                          (GstPadProbeType)(GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST),
+                                          drop_probe, nullptr, nullptr);
+    }
+
+    // Stop source-side first so nothing pushes into a half-torn-down
+    // element, then bring them back sink-side first.
+    for (size_t i = 0; i < GROUP_COUNT; ++i) {
+        if (!(pending & (1u << i))) continue;
+        std::printf("[RECOVER] restarting %s\n", g_groups[i].name);
+        for (GstElement* e : g_groups[i].elements) gst_element_set_state(e, GST_STATE_NULL);
+        // The old instances are stopped now, so any further error or EOS
+        // belongs to the restarted group.
+        g_groups[i].failed = false;
+    }
+    // videotestsrc restarts its timestamps from zero; offset them to the
+    // current running time so they stay monotonic for the mux and the
+    // TTFF probes.
+    if ((pending & (1u << GROUP_CAMERA)) && g_testSrc) {
+        g_object_set(G_OBJECT(g_testSrc), "timestamp-offset", (gint64)running_time_now(), nullptr);
+    }
+    for (size_t i = GROUP_COUNT; i-- > 0;) {
+        if (!(pending & (1u << i))) continue;
+        for (size_t j = g_groups[i].elements.size(); j-- > 0;) {
+            if (!gst_element_sync_state_with_parent(g_groups[i].elements[j])) {
+                std::fprintf(stderr, "[RECOVER] failed to restart %s\n", g_groups[i].name);
+                if (g_loop) g_main_loop_quit(g_loop);
+                return G_SOURCE_REMOVE;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < GROUP_COUNT; ++i) {
+        if (!feedProbes[i]) continue;
+        GstPad* peer = gst_pad_get_peer(g_groups[i].feed);
+        if (peer) {
+            gst_pad_sticky_events_foreach(g_groups[i].feed, resend_sticky, peer);
+            gst_object_unref(peer);
+        }
+        gst_pad_remove_probe(g_groups[i].feed, feedProbes[i]);
+    }
+
+    // A restarted encoder opens with an IDR anyway; after a camera-only
+    // restart this keeps the receiver from waiting out the GOP.
+    request_keyframe();
+    return G_SOURCE_REMOVE;
+}
+
+static int find_group(GstObject* obj)
+{
+    for (size_t i = 0; i < GROUP_COUNT; ++i) {
+        for (GstElement* e : g_groups[i].elements) {
+            if (owns(e, obj)) return (int)i;
+        }
+    }
+    return -1;
+}
+
+static gboolean on_group_failed(gpointer data)
+{
+    const size_t i = GPOINTER_TO_SIZE(data);
+    // Already covered by a restart that ran since this was queued.
+    if (!g_groups[i].failed) return G_SOURCE_REMOVE;
+
+    if (g_pendingGroups == 0) g_idle_add(restart_groups, nullptr);
+    g_pendingGroups |= 1u << i;
+    return G_SOURCE_REMOVE;
+}
+
+// Callable from any thread; a group's error and the EOS that usually
+// follows it schedule a single restart.
+static void mark_failed(size_t i)
+{
+    if (!g_groups[i].failed.exchange(true)) g_idle_add(on_group_failed, GSIZE_TO_POINTER(i));
+}
+
+static SideBranch* find_branch(GstObject* obj)
+{
+    for (SideBranch& b : g_branches) {
+        if (b.queue && (owns(b.queue, obj) || owns(b.sink, obj))) return &b;
+    }
+    return nullptr;
+}
+
+// Sits on the branch queue's sink pad, i.e. on the tee's push. Once the
+// branch is dead every buffer is swallowed here with GST_FLOW_OK, so the
+// error the queue would return never reaches the tee.
+static GstPadProbeReturn branch_probe(GstPad*, GstPadProbeInfo*, gpointer data)
+{
+    const SideBranch* b = static_cast<const SideBranch*>(data);
+    return b->dead.load(std::memory_order_acquire) ? GST_PAD_PROBE_DROP : GST_PAD_PROBE_OK;
+}
+
+// shmsink copies each frame into its shared area in render, and when the
+// area is full it waits for the consumer while still holding the camera
+// buffer. Making that one copy here, from shmsink's own allocator, keeps it
+// from ever waiting: a full area drops the frame, and the camera buffer is
+// released as soon as the copy is done. Runs in the q_shm thread.
+static GstPadProbeReturn shm_copy_probe(GstPad* pad, GstPadProbeInfo* info, gpointer)
+{
+    if (!g_shmAllocator) {
+        GstCaps* caps = gst_pad_get_current_caps(pad);
+        GstQuery* query = gst_query_new_allocation(caps, TRUE);
+        if (gst_pad_query(pad, query) && gst_query_get_n_allocation_params(query) > 0) {
+            gst_query_parse_nth_allocation_param(query, 0, &g_shmAllocator, &g_shmParams);
+        }
+        gst_query_unref(query);
+        if (caps) gst_caps_unref(caps);
+        if (!g_shmAllocator) return GST_PAD_PROBE_DROP;
+    }
+
+    GstBuffer* buf = GST_PAD_PROBE_INFO_BUFFER(info);
+    const gsize size = gst_buffer_get_size(buf);
+    GstMemory* mem = gst_allocator_alloc(g_shmAllocator, size, &g_shmParams);
+    if (!mem) return GST_PAD_PROBE_DROP;
+
+    GstMapInfo map;
+    if (!gst_memory_map(mem, &map, GST_MAP_WRITE)) {
+        gst_memory_unref(mem);
+        return GST_PAD_PROBE_DROP;
+    }
+    gst_buffer_extract(buf, 0, map.data, size);
+    gst_memory_unmap(mem, &map);
+
+    GstBuffer* copy = gst_buffer_new();
+    gst_buffer_copy_into(copy, buf, GST_BUFFER_COPY_METADATA, 0, -1);
+    gst_buffer_append_memory(copy, mem);
+    gst_buffer_unref(buf);
+    GST_PAD_PROBE_INFO_DATA(info) = copy;
+    return GST_PAD_PROBE_OK;
+}
+
+// Runs in the streaming thread that posts the error, before its flow return
+// unwinds into the branch queue, so the next tee push is already dropped.
+static GstBusSyncReply bus_sync(GstBus* /*bus*/, GstMessage* msg, gpointer /*data*/)
+{
+    if (GST_MESSAGE_TYPE(msg) == GST_MESSAGE_ERROR) {
+        SideBranch* b = find_branch(GST_MESSAGE_SRC(msg));
+        if (b) b->dead.store(true, std::memory_order_release);
+
+        const int group = find_group(GST_MESSAGE_SRC(msg));
+        if (group >= 0) mark_failed((size_t)group);
+    }
+    return GST_BUS_PASS;
+}
+
+static bool try_recover(GstObject* failed)
+{
+    SideBranch* b = find_branch(failed);
+    if (b) {
+        if (!b->reported) {
+            std::fprintf(stderr, "[RECOVER] dropped %s branch\n", b->name);
+            b->reported = true;
+        }
+        return true;
+    }
+
+    // Groups were already scheduled for restart by bus_sync.
+    return find_group(failed) >= 0;
+}
+
+// A live camera or encoder never ends on its own, so EOS at a group's
+// output means it failed (with or without posting an error). It must not
+// reach the mux or sink, which would end the stream; restart the group
+// instead.
+static GstPadProbeReturn eos_probe(GstPad*, GstPadProbeInfo* info, gpointer data)
+{
+    GstEvent* ev = GST_PAD_PROBE_INFO_EVENT(info);
+    if (GST_EVENT_TYPE(ev) != GST_EVENT_EOS) return GST_PAD_PROBE_OK;
+
+    const size_t i = GPOINTER_TO_SIZE(data);
+    std::fprintf(stderr, "[RECOVER] EOS from %s\n", g_groups[i].name);
+    mark_failed(i);
+    return GST_PAD_PROBE_DROP;
+}
+
+static GstPadProbeReturn keyframe_probe(GstPad*, GstPadProbeInfo* info, gpointer)
+{
+    if (g_ttffState.load() != TTFF_WAIT_KEY) return GST_PAD_PROBE_OK;
+
+    GstBuffer* buf = GST_PAD_PROBE_INFO_BUFFER(info);
+    if (GST_BUFFER_FLAG_IS_SET(buf, GST_BUFFER_FLAG_DELTA_UNIT)) return GST_PAD_PROBE_OK;
+    const GstClockTime pts = GST_BUFFER_PTS(buf);
+    if (GST_CLOCK_TIME_IS_VALID(pts) && pts < g_ttffMinPts.load()) return GST_PAD_PROBE_OK;
+
+    g_ttffKeyPts = GST_CLOCK_TIME_IS_VALID(pts) ? pts : 0;
+    int expected = TTFF_WAIT_KEY;
+    g_ttffState.compare_exchange_strong(expected, TTFF_WAIT_SEND);
+    return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn ttff_probe(GstPad*, GstPadProbeInfo* info, gpointer)
+{
+    if (g_ttffState.load() != TTFF_WAIT_SEND) return GST_PAD_PROBE_OK;
+
+    GstBuffer* buf = (GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_BUFFER_LIST)
+                         ? gst_buffer_list_get(GST_PAD_PROBE_INFO_BUFFER_LIST(info), 0)
+                         : GST_PAD_PROBE_INFO_BUFFER(info);
+    const GstClockTime pts = buf ? GST_BUFFER_PTS(buf) : GST_CLOCK_TIME_NONE;
+    if (GST_CLOCK_TIME_IS_VALID(pts) && pts < g_ttffKeyPts.load()) return GST_PAD_PROBE_OK;
+
+    int expected = TTFF_WAIT_SEND;
+    if (!g_ttffState.compare_exchange_strong(expected, TTFF_IDLE)) return GST_PAD_PROBE_OK;
+
+    const int recoveries = g_recoveries.load();
+    const gint64 now = g_get_monotonic_time();
+    const gint64 start = g_ttffStartUs.load();
+    if (recoveries == 0) {
+        std::printf("[TTFF] cold start: %.1f ms (process start: %.1f ms)\n",
+                    (now - start) / 1000.0, (now - g_processStartUs) / 1000.0);
+    } else {
+        std::printf("[TTFF] recovery #%d: %.1f ms\n", recoveries, (now - start) / 1000.0);
+    }
+    return GST_PAD_PROBE_OK;
+}
+
 static gboolean bus_call(GstBus* bus, GstMessage* msg, gpointer /*data*/)
 {
     switch (GST_MESSAGE_TYPE(msg)) {
@@ -20,11 +383,12 @@ static gboolean bus_call(GstBus* bus, GstMessage* msg, gpointer /*data*/)
         GError* err = nullptr;
         gchar* dbg = nullptr;
         gst_message_parse_error(msg, &err, &dbg);
-        std::fprintf(stderr, "[GST] ERROR: %s\n", err ? err->message : "unknown");
+        std::fprintf(stderr, "[GST] ERROR from %s: %s\n",
+                     GST_OBJECT_NAME(GST_MESSAGE_SRC(msg)), err ? err->message : "unknown");
         if (dbg) std::fprintf(stderr, "[GST] DEBUG: %s\n", dbg);
         if (err) g_error_free(err);
         if (dbg) g_free(dbg);
-        if (g_loop) g_main_loop_quit(g_loop);
+        if (!try_recover(GST_MESSAGE_SRC(msg)) && g_loop) g_main_loop_quit(g_loop);
         break;
     }
     case GST_MESSAGE_EOS:
@@ -52,33 +416,132 @@ static void set_caps(GstElement* capsfilter, int width, int height, int fps)
     gst_caps_unref(caps);
 }
 
+static void usage(const char* prog)
+{
+    std::fprintf(stderr, "Usage: %s [host] [port] [--rtp] [--fec <percent>] [--spectator <host:port>]... [--shm <socket>] [--test-src]\n", prog);
+    std::fprintf(stderr, "  --rtp                    send H264 as RTP (pt %u) instead of MPEG-TS\n", RTP_PT_H264);
+    std::fprintf(stderr, "  --fec <percent>          add ULPFEC (pt %u) with the given overhead, implies --rtp\n", RTP_PT_ULPFEC);
+    std::fprintf(stderr, "  --spectator <host:port>  also send the encoded stream there (repeatable)\n");
+    std::fprintf(stderr, "  --shm <socket>           export raw NV12 frames to local shmsrc consumers\n");
+    std::fprintf(stderr, "  --test-src               live test pattern instead of the camera (loopback benchmarks)\n");
+}
+
 int main(int argc, char** argv)
 {
-    const char* host = (argc >= 2) ? argv[1] : "192.168.0.188";
-    const int port = (argc >= 3) ? std::atoi(argv[2]) : 5600;
+    g_processStartUs = g_get_monotonic_time();
+    gst_init(&argc, &argv);
+
+    const char* host = "192.168.0.188";
+    int port = 5600;
+    bool rtp = false;
+    int fecPercent = 0;
+    std::string spectators;
+    const char* shmPath = nullptr;
+    bool testSrc = false;
+
+    int positional = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--rtp") == 0) {
+            rtp = true;
+        } else if (std::strcmp(argv[i], "--fec") == 0 && i + 1 < argc) {
+            fecPercent = std::atoi(argv[++i]);
+            if (fecPercent < 0 || fecPercent > 100) {
+                std::fprintf(stderr, "FEC overhead must be 0..100%%\n");
+                return 1;
+            }
+            rtp = rtp || fecPercent > 0;
+        } else if (std::strcmp(argv[i], "--spectator") == 0 && i + 1 < argc) {
+            const char* client = argv[++i];
+            if (!std::strchr(client, ':')) {
+                std::fprintf(stderr, "Spectator must be host:port, got '%s'\n", client);
+                return 1;
+            }
+            if (!spectators.empty()) spectators += ',';
+            spectators += client;
+        } else if (std::strcmp(argv[i], "--shm") == 0 && i + 1 < argc) {
+            shmPath = argv[++i];
+        } else if (std::strcmp(argv[i], "--test-src") == 0) {
+            testSrc = true;
+        } else if (argv[i][0] != '-' && positional == 0) {
+            host = argv[i];
+            ++positional;
+        } else if (argv[i][0] != '-' && positional == 1) {
+            port = std::atoi(argv[i]);
+            ++positional;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
 
     std::signal(SIGINT, onSignal);
     std::signal(SIGTERM, onSignal);
 
-    gst_init(&argc, &argv);
-
     GstElement* pipeline   = gst_pipeline_new("video_tx");
-    GstElement* src        = gst_element_factory_make("libcamerasrc", "src");
+    GstElement* src        = gst_element_factory_make(testSrc ? "videotestsrc" : "libcamerasrc", "src");
     GstElement* capsfilter = gst_element_factory_make("capsfilter", "caps");
     GstElement* queue      = gst_element_factory_make("queue", "q");
     GstElement* enc        = gst_element_factory_make("v4l2h264enc", "enc");
     GstElement* queue2     = gst_element_factory_make("queue", "q2");
     GstElement* parse      = gst_element_factory_make("h264parse", "parse");
-    GstElement* mux        = gst_element_factory_make("mpegtsmux", "mux");
     GstElement* sink       = gst_element_factory_make("udpsink", "sink");
 
-    if (!pipeline || !src || !capsfilter || !queue || !enc || !queue2 || !parse || !mux || !sink) {
+    // TS mode muxes into MPEG-TS; RTP mode payloads directly so ULPFEC can
+    // protect the packets of each frame (rtpulpfecenc closes a group on the
+    // RTP marker bit, i.e. once per access unit).
+    GstElement* mux = nullptr;
+    GstElement* pay = nullptr;
+    GstElement* fec = nullptr;
+    if (rtp) {
+        pay = gst_element_factory_make("rtph264pay", "pay");
+        if (fecPercent > 0) fec = gst_element_factory_make("rtpulpfecenc", "fec");
+    } else {
+        mux = gst_element_factory_make("mpegtsmux", "mux");
+    }
+
+    // Fan-out only exists when asked for, so the plain driver pipeline stays
+    // linear. tee hands out buffer references, never copies; every extra
+    // branch sits behind a leaky queue so a slow consumer drops its own
+    // frames instead of back-pressuring the driver's stream.
+    GstElement* rawTee   = nullptr;
+    GstElement* shmQueue = nullptr;
+    GstElement* shm      = nullptr;
+    if (shmPath) {
+        rawTee   = gst_element_factory_make("tee", "raw_tee");
+        shmQueue = gst_element_factory_make("queue", "q_shm");
+        shm      = gst_element_factory_make("shmsink", "shm");
+    }
+
+    GstElement* outTee    = nullptr;
+    GstElement* specQueue = nullptr;
+    GstElement* spec      = nullptr;
+    if (!spectators.empty()) {
+        outTee    = gst_element_factory_make("tee", "out_tee");
+        specQueue = gst_element_factory_make("queue", "q_spec");
+        spec      = gst_element_factory_make("multiudpsink", "spec");
+    }
+
+    if (!pipeline || !src || !capsfilter || !queue || !enc || !queue2 || !parse || !sink ||
+        (rtp ? (!pay || (fecPercent > 0 && !fec)) : !mux) ||
+        (shmPath && (!rawTee || !shmQueue || !shm)) ||
+        (!spectators.empty() && (!outTee || !specQueue || !spec))) {
         std::fprintf(stderr, "Failed to create one or more GStreamer elements.\n");
-        std::fprintf(stderr, "Check plugins installed: libcamerasrc, v4l2h264enc, h264parse, mpegtsmux.\n");
+        std::fprintf(stderr, "Check plugins installed: %s, v4l2h264enc, h264parse, %s%s%s.\n",
+                     testSrc ? "videotestsrc" : "libcamerasrc",
+                     rtp ? "rtph264pay, rtpulpfecenc" : "mpegtsmux",
+                     shmPath ? ", shmsink" : "",
+                     spectators.empty() ? "" : ", multiudpsink");
         return 1;
     }
 
-    set_caps(capsfilter, 640, 360, 30);
+    set_caps(capsfilter, WIDTH, HEIGHT, FPS);
+
+    if (testSrc) {
+        g_object_set(G_OBJECT(src),
+                     "is-live", TRUE,
+                     nullptr);
+        gst_util_set_object_arg(G_OBJECT(src), "pattern", "ball");
+    }
 
     g_object_set(G_OBJECT(queue),
                  "max-size-buffers", 1,
@@ -103,9 +566,30 @@ int main(int argc, char** argv)
                  "config-interval", 1,
                  nullptr);
 
-    g_object_set(G_OBJECT(mux),
-                 "alignment", 7,
-                 nullptr);
+    if (mux) {
+        g_object_set(G_OBJECT(mux),
+                     "alignment", 7,
+                     nullptr);
+    }
+
+    if (pay) {
+        g_object_set(G_OBJECT(pay),
+                     "pt", RTP_PT_H264,
+                     "mtu", RTP_MTU,
+                     "config-interval", 0,
+                     nullptr);
+    }
+
+    if (fec) {
+        // Same-SSRC ULPFEC (RFC 5109): FEC packets share the media sequence
+        // space, so the receiver's jitterbuffer reports the gaps it can repair.
+        g_object_set(G_OBJECT(fec),
+                     "pt", RTP_PT_ULPFEC,
+                     "percentage", (guint)fecPercent,
+                     "percentage-important", (guint)fecPercent,
+                     "multipacket", TRUE,
+                     nullptr);
+    }
 
     g_object_set(G_OBJECT(sink),
                  "host", host,
@@ -114,19 +598,159 @@ int main(int argc, char** argv)
                  "async", FALSE,
                  nullptr);
 
-    gst_bin_add_many(GST_BIN(pipeline), src, capsfilter, queue, enc, queue2, parse, mux, sink, nullptr);
+    if (shm) {
+        // libcamerasrc's buffers are dmabufs, but handing them to consumers
+        // (unixfdsink) would let a stalled one hold the camera's small pool
+        // and starve the encoder. Each frame is copied once into shmsink's
+        // area instead, by shm_copy_probe, which never waits on a consumer,
+        // so no camera buffer stays in this branch longer than one copy.
+        g_object_set(G_OBJECT(shmQueue),
+                     "max-size-buffers", 1,
+                     "max-size-bytes", 0,
+                     "max-size-time", (guint64)0,
+                     "leaky", 2,
+                     nullptr);
+
+        g_object_set(G_OBJECT(shm),
+                     "socket-path", shmPath,
+                     "shm-size", (guint)(WIDTH * HEIGHT * 3 / 2 * SHM_FRAMES),
+                     "wait-for-connection", FALSE,
+                     "sync", FALSE,
+                     "async", FALSE,
+                     nullptr);
+    }
+
+    if (spec) {
+        g_object_set(G_OBJECT(specQueue),
+                     "max-size-buffers", 64,
+                     "max-size-bytes", 0,
+                     "max-size-time", (guint64)0,
+                     "leaky", 2,
+                     nullptr);
+
+        g_object_set(G_OBJECT(spec),
+                     "clients", spectators.c_str(),
+                     "sync", FALSE,
+                     "async", FALSE,
+                     nullptr);
+    }
+
+    gst_bin_add_many(GST_BIN(pipeline), src, capsfilter, queue, enc, queue2, parse, sink, nullptr);
+
+    bool linked;
+    if (rawTee) {
+        gst_bin_add_many(GST_BIN(pipeline), rawTee, shmQueue, shm, nullptr);
+        linked = gst_element_link_many(src, capsfilter, rawTee, queue, enc, queue2, parse, nullptr) &&
+                 gst_element_link_many(rawTee, shmQueue, shm, nullptr);
+    } else {
+        linked = gst_element_link_many(src, capsfilter, queue, enc, queue2, parse, nullptr);
+    }
 
-    if (!gst_element_link_many(src, capsfilter, queue, enc, queue2, parse, mux, sink, nullptr)) {
+    GstElement* last = parse;
+    if (linked && mux) {
+        gst_bin_add(GST_BIN(pipeline), mux);
+        linked = gst_element_link(last, mux);
+        last = mux;
+    } else if (linked) {
+        gst_bin_add(GST_BIN(pipeline), pay);
+        linked = gst_element_link(last, pay);
+        last = pay;
+        if (linked && fec) {
+            gst_bin_add(GST_BIN(pipeline), fec);
+            linked = gst_element_link(last, fec);
+            last = fec;
+        }
+    }
+
+    // The driver's sink is linked to the tee first, so tee pushes each
+    // packet to its socket before the spectator queue sees it.
+    if (linked && outTee) {
+        gst_bin_add_many(GST_BIN(pipeline), outTee, specQueue, spec, nullptr);
+        linked = gst_element_link_many(last, outTee, sink, nullptr) &&
+                 gst_element_link_many(outTee, specQueue, spec, nullptr);
+    } else if (linked) {
+        linked = gst_element_link(last, sink);
+    }
+
+    if (!linked) {
         std::fprintf(stderr, "Failed to link pipeline elements\n");
         return 1;
     }
 
+    g_pipeline = pipeline;
+    g_enc = enc;
+    if (testSrc) g_testSrc = src;
+    g_groups[GROUP_CAMERA].name = "camera";
+    g_groups[GROUP_CAMERA].elements = {src, capsfilter};
+    g_groups[GROUP_ENCODER].name = "encoder";
+    g_groups[GROUP_ENCODER].elements = {queue, enc};
+
+    GstPad* queueSink = gst_element_get_static_pad(queue, "sink");
+    g_groups[GROUP_ENCODER].feed = gst_pad_get_peer(queueSink);
+    gst_object_unref(queueSink);
+    if (shm) {
+        g_branches[BRANCH_SHM].name = "shm";
+        g_branches[BRANCH_SHM].queue = shmQueue;
+        g_branches[BRANCH_SHM].sink = shm;
+    }
+    if (spec) {
+        g_branches[BRANCH_SPECTATOR].name = "spectator";
+        g_branches[BRANCH_SPECTATOR].queue = specQueue;
+        g_branches[BRANCH_SPECTATOR].sink = spec;
+    }
+
+    GstPad* pad;
+    for (SideBranch& b : g_branches) {
+        if (!b.queue) continue;
+        // rtph264pay pushes buffer lists, so both kinds must be dropped.
+        pad = gst_element_get_static_pad(b.queue, "sink");
+        gst_pad_add_probe(pad, (GstPadProbeType)(GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST),
+                          branch_probe, &b, nullptr);
+        gst_object_unref(pad);
+    }
+
+    if (shm) {
+        pad = gst_element_get_static_pad(shm, "sink");
+        gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, shm_copy_probe, nullptr, nullptr);
+        gst_object_unref(pad);
+    }
+
+    pad = gst_element_get_static_pad(capsfilter, "src");
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, eos_probe, GSIZE_TO_POINTER(GROUP_CAMERA), nullptr);
+    gst_object_unref(pad);
+
+    pad = gst_element_get_static_pad(enc, "src");
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, eos_probe, GSIZE_TO_POINTER(GROUP_ENCODER), nullptr);
+    gst_object_unref(pad);
+
+    // h264parse flags delta units from the bitstream itself, so this does
+    // not depend on what the encoder sets on its output.
+    pad = gst_element_get_static_pad(parse, "src");
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, keyframe_probe, nullptr, nullptr);
+    gst_object_unref(pad);
+
+    pad = gst_element_get_static_pad(sink, "sink");
+    gst_pad_add_probe(pad, (GstPadProbeType)(GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST),
+                      ttff_probe, nullptr, nullptr);
+    gst_object_unref(pad);
+
     GstBus* bus = gst_pipeline_get_bus(GST_PIPELINE(pipeline));
+    gst_bus_set_sync_handler(bus, bus_sync, nullptr, nullptr);
     gst_bus_add_watch(bus, bus_call, nullptr);
     gst_object_unref(bus);
 
-    std::printf("Starting video TX to %s:%d (640x360@30 H264/MPEGTS over UDP)\n", host, port);
+    if (fec) {
+        std::printf("Starting video TX to %s:%d (%dx%d@%d H264/RTP + %d%% ULPFEC over UDP)\n",
+                    host, port, WIDTH, HEIGHT, FPS, fecPercent);
+    } else {
+        std::printf("Starting video TX to %s:%d (%dx%d@%d H264/%s over UDP)\n",
+                    host, port, WIDTH, HEIGHT, FPS, rtp ? "RTP" : "MPEGTS");
+    }
+    if (spec) std::printf("Spectators: %s\n", spectators.c_str());
+    if (shm) std::printf("Raw NV12 tap: %s\n", shmPath);
 
+    g_ttffStartUs = g_get_monotonic_time();
+    g_ttffState = TTFF_WAIT_KEY;
     GstStateChangeReturn ret = gst_element_set_state(pipeline, GST_STATE_PLAYING);
     if (ret == GST_STATE_CHANGE_FAILURE) {
         std::fprintf(stderr, "Failed to set pipeline to PLAYING\n");
@@ -140,6 +764,10 @@ int main(int argc, char** argv)
     std::printf("\nStopping...\n");
     gst_element_set_state(pipeline, GST_STATE_NULL);
 
+    for (RestartGroup& g : g_groups) {
+        if (g.feed) gst_object_unref(g.feed);
+    }
+    if (g_shmAllocator) gst_object_unref(g_shmAllocator);
     gst_object_unref(pipeline);
     if (g_loop) {
         g_main_loop_unref(g_loop);